@@ -8,6 +8,12 @@ const float GRAY_B = 0.114f;
 const float GRAY_G = 0.587f;
 const float GRAY_R = 0.299f;
 
+// GRAY_* weights in fixed point, they sum up to 1 << GRAY_SHIFT
+const int GRAY_SHIFT = 16;
+const int GRAY_B_FIXED = 7471;
+const int GRAY_G_FIXED = 38470;
+const int GRAY_R_FIXED = 19595;
+
 const int BLUE_IDX = 0;
 const int GREEN_IDX = 1;
 const int RED_IDX = 2;
@@ -16,5 +22,14 @@ const int HUE_IDX = 0;
 const int SAT_IDX = 1;
 const int VAL_IDX = 2;
 
+const int RANK_KERNEL_SIZE = 3;
+const int RANK_INDEX = 4;
+
+// bump whenever a change in the pipeline changes detection results, cached results are keyed by it
+const int PIPELINE_VERSION = 3;
+
+// upper estimate of the memory the detection pipeline holds per pixel of a tile
+const int TILE_BYTES_PER_PIXEL = 16;
+
 
 #endif //POBR_CONSTANTS_H
@@ -0,0 +1,224 @@
+#include "DetectionCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <iterator>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+namespace {
+
+    const std::string CACHE_EXTENSION = ".yml";
+
+    bool endsWith(const std::string &value, const std::string &suffix) {
+        return value.size() >= suffix.size() &&
+               value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+}
+
+DetectionCache::DetectionCache(const std::string &directory, size_t maxBytes)
+        : directory_(directory), max_bytes_(maxBytes), size_(0), stats_() {
+    mkdir(directory_.c_str(), 0755);
+    scan();
+    if (size_ > max_bytes_) {
+        evict();
+    }
+}
+
+bool DetectionCache::loadRects(const std::string &key, std::vector<cv::Rect> &rects) {
+    const std::string entryPath = path(key, "rects");
+    cv::FileStorage fs;
+    try {
+        if (open(entryPath, fs)) {
+            cv::FileNode node = fs["rects"];
+            if (node.isSeq()) {
+                rects.clear();
+                node >> rects;
+                stats_.rectHits++;
+                return true;
+            }
+            // an entry without its sequence is as corrupt as one that does not parse
+            discard(entryPath);
+        }
+    } catch (const cv::Exception &) {
+        // a corrupt entry is dropped and counted as a miss
+        discard(entryPath);
+    }
+    rects.clear();
+    stats_.rectMisses++;
+    return false;
+}
+
+void DetectionCache::storeRects(const std::string &key, const std::vector<cv::Rect> &rects) {
+    store(path(key, "rects"), [&rects](cv::FileStorage &fs) {
+        fs << "rects" << rects;
+    });
+}
+
+bool DetectionCache::loadFeatures(const std::string &key, std::vector<ObjectFeatures> &features) {
+    const std::string entryPath = path(key, "features");
+    cv::FileStorage fs;
+    try {
+        if (open(entryPath, fs)) {
+            cv::FileNode nodes = fs["features"];
+            if (nodes.isSeq()) {
+                features.clear();
+                for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+                    features.push_back(ObjectFeatures(*it));
+                }
+                stats_.featureHits++;
+                return true;
+            }
+            // an entry without its sequence is as corrupt as one that does not parse
+            discard(entryPath);
+        }
+    } catch (const cv::Exception &) {
+        // a corrupt entry is dropped and counted as a miss
+        discard(entryPath);
+    }
+    features.clear();
+    stats_.featureMisses++;
+    return false;
+}
+
+void DetectionCache::storeFeatures(const std::string &key, const std::vector<ObjectFeatures> &features) {
+    store(path(key, "features"), [&features](cv::FileStorage &fs) {
+        fs << "features" << "[";
+        for (const ObjectFeatures &f : features) {
+            f.write(fs);
+        }
+        fs << "]";
+    });
+}
+
+const DetectionCache::Stats &DetectionCache::stats() const {
+    return stats_;
+}
+
+void DetectionCache::print() {
+    std::cout << "Cache rects hits: " << stats_.rectHits << '\t' << "misses: " << stats_.rectMisses << '\t'
+              << "features hits: " << stats_.featureHits << '\t' << "misses: " << stats_.featureMisses << '\t'
+              << "evictions: " << stats_.evictions << std::endl;
+}
+
+uint64_t DetectionCache::hash(const void *data, size_t size, uint64_t seed) {
+    const uint64_t prime = 1099511628211ULL;
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint64_t result = seed;
+    for (size_t i = 0; i < size; ++i) {
+        result = (result ^ bytes[i]) * prime;
+    }
+    return result;
+}
+
+std::string DetectionCache::toKey(uint64_t hash) {
+    char buffer[17];
+    std::snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(hash));
+    return std::string(buffer);
+}
+
+std::string DetectionCache::path(const std::string &key, const std::string &kind) const {
+    return directory_ + "/" + key + "." + kind + CACHE_EXTENSION;
+}
+
+bool DetectionCache::open(const std::string &path, cv::FileStorage &fs) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !fs.open(path, cv::FileStorage::READ)) {
+        return false;
+    }
+    // modification time carries the use order over to the next run
+    utime(path.c_str(), nullptr);
+    touch(path, static_cast<size_t>(info.st_size));
+    return true;
+}
+
+void DetectionCache::store(const std::string &path, const std::function<void(cv::FileStorage &)> &writeFunc) {
+    // written under a temporary name first, so readers never see a partial entry
+    std::string tmpPath = path.substr(0, path.size() - CACHE_EXTENSION.size()) + ".tmp" + CACHE_EXTENSION;
+    try {
+        cv::FileStorage fs(tmpPath, cv::FileStorage::WRITE);
+        if (!fs.isOpened()) return;
+        writeFunc(fs);
+        fs.release();
+    } catch (const cv::Exception &) {
+        std::remove(tmpPath.c_str());
+        return;
+    }
+
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        return;
+    }
+
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0) {
+        touch(path, static_cast<size_t>(info.st_size));
+    }
+    if (size_ > max_bytes_) {
+        evict();
+    }
+}
+
+void DetectionCache::discard(const std::string &path) {
+    std::remove(path.c_str());
+    forget(path);
+}
+
+void DetectionCache::touch(const std::string &path, size_t size) {
+    forget(path);
+    lru_.push_back({path, size});
+    index_[path] = std::prev(lru_.end());
+    size_ += size;
+}
+
+void DetectionCache::forget(const std::string &path) {
+    auto it = index_.find(path);
+    if (it == index_.end()) return;
+    size_ -= it->second->size;
+    lru_.erase(it->second);
+    index_.erase(it);
+}
+
+void DetectionCache::scan() {
+    struct Found {
+        std::string path;
+        struct timespec used;
+        size_t size;
+    };
+    std::vector<Found> found;
+
+    DIR *dir = opendir(directory_.c_str());
+    if (!dir) return;
+    while (dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (!endsWith(name, CACHE_EXTENSION)) continue;
+        std::string entryPath = directory_ + "/" + name;
+        struct stat info;
+        if (stat(entryPath.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+            found.push_back({entryPath, info.st_mtim, static_cast<size_t>(info.st_size)});
+        }
+    }
+    closedir(dir);
+
+    // nanoseconds keep apart entries used within the same second
+    std::sort(found.begin(), found.end(), [](const Found &a, const Found &b) {
+        return a.used.tv_sec < b.used.tv_sec || (a.used.tv_sec == b.used.tv_sec && a.used.tv_nsec < b.used.tv_nsec);
+    });
+    for (const Found &entry : found) {
+        touch(entry.path, entry.size);
+    }
+}
+
+void DetectionCache::evict() {
+    // going below the limit leaves room for the next entries before evicting again
+    const size_t lowWater = max_bytes_ / 10 * 9;
+    while (size_ > lowWater && !lru_.empty()) {
+        std::string path = lru_.front().path;
+        std::remove(path.c_str());
+        forget(path);
+        stats_.evictions++;
+    }
+}
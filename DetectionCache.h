@@ -0,0 +1,87 @@
+#ifndef POBR_DETECTIONCACHE_H
+#define POBR_DETECTIONCACHE_H
+
+#include <opencv2/core/core.hpp>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include "ObjectFeatures.h"
+
+/**
+ * On-disk cache of detection results, stored as one file per key in the given directory.
+ * Least recently used entries are removed once the files take more than maxBytes, until they take 90% of it.
+ * Use order is kept in memory, the directory is scanned once on construction and modification times
+ * carry the order over to the next run.
+ */
+class DetectionCache {
+public:
+    struct Stats {
+        int rectHits;
+        int rectMisses;
+        int featureHits;
+        int featureMisses;
+        int evictions;
+    };
+
+    DetectionCache(const std::string &directory, size_t maxBytes);
+
+    bool loadRects(const std::string &key, std::vector<cv::Rect> &rects);
+
+    void storeRects(const std::string &key, const std::vector<cv::Rect> &rects);
+
+    bool loadFeatures(const std::string &key, std::vector<ObjectFeatures> &features);
+
+    void storeFeatures(const std::string &key, const std::vector<ObjectFeatures> &features);
+
+    const Stats &stats() const;
+
+    void print();
+
+    /**
+     * FNV-1a hash, seed allows chaining hashes of several buffers.
+     */
+    static uint64_t hash(const void *data, size_t size, uint64_t seed = 14695981039346656037ULL);
+
+    static std::string toKey(uint64_t hash);
+
+private:
+    struct Entry {
+        std::string path;
+        size_t size;
+    };
+
+    std::string directory_;
+    size_t max_bytes_;
+    size_t size_;
+    Stats stats_;
+    // least recently used first
+    std::list<Entry> lru_;
+    std::map<std::string, std::list<Entry>::iterator> index_;
+
+    std::string path(const std::string &key, const std::string &kind) const;
+
+    bool open(const std::string &path, cv::FileStorage &fs);
+
+    void store(const std::string &path, const std::function<void(cv::FileStorage &)> &writeFunc);
+
+    /**
+     * Records an entry as the most recently used one, replacing a previous record of it.
+     */
+    void touch(const std::string &path, size_t size);
+
+    void forget(const std::string &path);
+
+    void scan();
+
+    /**
+     * Removes a single entry, used for entries that cannot be read.
+     */
+    void discard(const std::string &path);
+
+    void evict();
+};
+
+#endif //POBR_DETECTIONCACHE_H
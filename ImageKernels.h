@@ -0,0 +1,146 @@
+#ifndef POBR_IMAGEKERNELS_H
+#define POBR_IMAGEKERNELS_H
+
+#include <opencv2/core/core.hpp>
+#include <algorithm>
+#include <array>
+#include <vector>
+#include "Constants.h"
+
+/**
+ * Compile-time specialized pixel kernels used by ImageUtils.
+ * Pixel type, channel count and (for the rank filter) kernel size and rank are template parameters,
+ * and all kernels work on raw row pointers, so the inner loops can be unrolled and vectorized.
+ */
+class ImageKernels {
+public:
+    template<typename T>
+    static void convertRGBToHSV(const cv::Mat &I, cv::Mat &res) {
+        for (int i = 0; i < I.rows; ++i) {
+            const T *src = I.ptr<T>(i);
+            uchar *dst = res.ptr<uchar>(i);
+            for (int j = 0; j < I.cols; ++j) {
+                const T *px = src + 3 * j;
+                int b = px[BLUE_IDX];
+                int g = px[GREEN_IDX];
+                int r = px[RED_IDX];
+                float maxVal = static_cast<float>(std::max(b, std::max(g, r)));
+                float minVal = static_cast<float>(std::min(b, std::min(g, r)));
+                float delta = maxVal - minVal;
+
+                float v = maxVal;
+                float s = v != 0 ? delta / v : 0;
+                float h;
+                if (delta == 0) {
+                    h = 0;
+                } else if (maxVal == b && b >= g) {
+                    h = 240 + 60 * (r - g) / delta;
+                } else if (maxVal == g) {
+                    h = 120 + 60 * (b - r) / delta;
+                } else {
+                    h = 60 * (g - b) / delta;
+                }
+
+                // values are wrapped into a byte the same way the original per-pixel conversion did
+                uchar *out = dst + 3 * j;
+                out[HUE_IDX] = static_cast<uchar>(static_cast<int>(h / 2));
+                out[SAT_IDX] = static_cast<uchar>(static_cast<int>(255 * s));
+                out[VAL_IDX] = static_cast<uchar>(static_cast<int>(255 * v));
+            }
+        }
+    }
+
+    template<typename T, int Channels>
+    static void inRange(const cv::Mat &I, cv::Mat &res, const cv::Scalar &s1, const cv::Scalar &s2) {
+        double low[Channels], high[Channels];
+        for (int n = 0; n < Channels; ++n) {
+            low[n] = s1.val[n];
+            high[n] = s2.val[n];
+        }
+        for (int i = 0; i < I.rows; ++i) {
+            const T *src = I.ptr<T>(i);
+            uchar *dst = res.ptr<uchar>(i);
+            for (int j = 0; j < I.cols; ++j) {
+                bool inside = true;
+                for (int n = 0; n < Channels; ++n) {
+                    double value = src[Channels * j + n];
+                    inside = inside && value >= low[n] && value <= high[n];
+                }
+                dst[j] = inside ? MAX_VAL : MIN_VAL;
+            }
+        }
+    }
+
+    /**
+     * Rank filter over 3-channel pixels ordered by their mean intensity.
+     * Sort keys pack the intensity with the position inside the window, so ties resolve deterministically.
+     */
+    template<typename T, int KernelSize, int Rank>
+    static void rankFilter(const cv::Mat &I, cv::Mat &res) {
+        constexpr int offset = KernelSize / 2;
+        constexpr int area = KernelSize * KernelSize;
+        static_assert(KernelSize % 2 == 1, "kernel size must be odd");
+        static_assert(Rank >= 0 && Rank < area, "rank out of kernel range");
+        static_assert(area <= 256, "window position must fit in the key's low byte");
+
+        std::array<int, area> keys;
+        const T *window[KernelSize];
+        for (int i = offset; i < I.rows - offset; ++i) {
+            for (int m = 0; m < KernelSize; ++m) {
+                window[m] = I.ptr<T>(i - offset + m);
+            }
+            T *dst = res.ptr<T>(i);
+            for (int j = offset; j < I.cols - offset; ++j) {
+                int count = 0;
+                for (int m = 0; m < KernelSize; ++m) {
+                    const T *px = window[m] + 3 * (j - offset);
+                    for (int n = 0; n < KernelSize; ++n, px += 3) {
+                        keys[count] = (((px[0] + px[1] + px[2]) / 3) << 8) | count;
+                        ++count;
+                    }
+                }
+                std::nth_element(keys.begin(), keys.begin() + Rank, keys.end());
+                int winner = keys[Rank] & 0xFF;
+                const T *px = window[winner / KernelSize] + 3 * (j - offset + winner % KernelSize);
+                dst[3 * j] = px[0];
+                dst[3 * j + 1] = px[1];
+                dst[3 * j + 2] = px[2];
+            }
+        }
+    }
+
+    /**
+     * Fallback for kernel sizes without a compiled specialization.
+     */
+    template<typename T>
+    static void rankFilter(const cv::Mat &I, cv::Mat &res, int kernelSize, int rank) {
+        const int offset = kernelSize / 2;
+        std::vector<std::pair<int, int>> keys(kernelSize * kernelSize);
+        std::vector<const T *> window(kernelSize);
+        for (int i = offset; i < I.rows - offset; ++i) {
+            for (int m = 0; m < kernelSize; ++m) {
+                window[m] = I.ptr<T>(i - offset + m);
+            }
+            T *dst = res.ptr<T>(i);
+            for (int j = offset; j < I.cols - offset; ++j) {
+                int count = 0;
+                for (int m = 0; m < kernelSize; ++m) {
+                    const T *px = window[m] + 3 * (j - offset);
+                    for (int n = 0; n < kernelSize; ++n, px += 3) {
+                        keys[count].first = (px[0] + px[1] + px[2]) / 3;
+                        keys[count].second = count;
+                        ++count;
+                    }
+                }
+                std::nth_element(keys.begin(), keys.begin() + rank, keys.end());
+                int winner = keys[rank].second;
+                const T *px = window[winner / kernelSize] + 3 * (j - offset + winner % kernelSize);
+                dst[3 * j] = px[0];
+                dst[3 * j + 1] = px[1];
+                dst[3 * j + 2] = px[2];
+            }
+        }
+    }
+};
+
+#endif //POBR_IMAGEKERNELS_H
@@ -0,0 +1,293 @@
+#include "ImageLoader.h"
+#include "DetectionCache.h"
+
+#include <opencv2/highgui/highgui.hpp>
+#include <cctype>
+#include <exception>
+#include <limits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    // freed buffers kept for reuse take at most this many bytes together
+    const size_t POOLED_BYTES = 128 * 1024 * 1024;
+
+    /**
+     * Allocator keeping freed image buffers and handing them out again for images of the same byte size.
+     * Only buffers of the size freed last are kept, so one large image does not pin memory once sizes change.
+     * Images allocated by it can outlive any loader, so a single instance lives for the whole process.
+     */
+    class BufferPool : public cv::MatAllocator {
+    public:
+        static BufferPool &instance() {
+            // never destroyed, images released during static destruction still return their buffers to it
+            static BufferPool *pool = new BufferPool();
+            return *pool;
+        }
+
+        cv::UMatData *allocate(int dims, const int *sizes, int type, void *data0, size_t *step, int flags,
+                               cv::UMatUsageFlags usageFlags) const override {
+            if (data0) {
+                return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data0, step, flags, usageFlags);
+            }
+            size_t total = CV_ELEM_SIZE(type);
+            for (int i = dims - 1; i >= 0; --i) {
+                if (step) {
+                    step[i] = total;
+                }
+                total *= sizes[i];
+            }
+            cv::UMatData *u = new cv::UMatData(this);
+            u->data = u->origdata = take(total);
+            u->size = total;
+            return u;
+        }
+
+        bool allocate(cv::UMatData *u, int, cv::UMatUsageFlags) const override {
+            return u != nullptr;
+        }
+
+        void deallocate(cv::UMatData *u) const override {
+            if (!u) return;
+            CV_Assert(u->urefcount == 0 && u->refcount == 0);
+            give(u->origdata, u->size);
+            delete u;
+        }
+
+    private:
+        mutable std::mutex mutex_;
+        mutable std::vector<uchar *> free_;
+        mutable size_t free_size_ = 0;
+
+        uchar *take(size_t size) const {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!free_.empty() && free_size_ == size) {
+                    uchar *data = free_.back();
+                    free_.pop_back();
+                    return data;
+                }
+            }
+            return static_cast<uchar *>(cv::fastMalloc(size));
+        }
+
+        void give(uchar *data, size_t size) const {
+            std::vector<uchar *> dropped;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (free_size_ != size) {
+                    dropped.swap(free_);
+                    free_size_ = size;
+                }
+                if ((free_.size() + 1) * size <= POOLED_BYTES) {
+                    free_.push_back(data);
+                } else {
+                    dropped.push_back(data);
+                }
+            }
+            for (uchar *buffer : dropped) {
+                cv::fastFree(buffer);
+            }
+        }
+    };
+
+    /**
+     * Parses the header of a binary PPM with 8-bit samples and checks the pixels are all there.
+     * Returns the offset of the pixels, 0 when the data is not such a file.
+     */
+    size_t parseRawHeader(const uchar *data, size_t size, int &width, int &height) {
+        if (size < 2 || data[0] != 'P' || data[1] != '6') return 0;
+        size_t pos = 2;
+        int values[3];
+        for (int &value : values) {
+            // whitespace and comments reaching to the end of their line separate the fields
+            while (pos < size && (std::isspace(data[pos]) || data[pos] == '#')) {
+                if (data[pos] == '#') {
+                    while (pos < size && data[pos] != '\n') ++pos;
+                } else {
+                    ++pos;
+                }
+            }
+            if (pos == size || !std::isdigit(data[pos])) return 0;
+            long long parsed = 0;
+            while (pos < size && std::isdigit(data[pos])) {
+                parsed = parsed * 10 + (data[pos++] - '0');
+                if (parsed > std::numeric_limits<int>::max()) return 0;
+            }
+            value = static_cast<int>(parsed);
+        }
+        // a single whitespace character ends the header
+        if (pos == size || !std::isspace(data[pos])) return 0;
+        ++pos;
+        width = values[0];
+        height = values[1];
+        if (width == 0 || height == 0 || values[2] != 255) return 0;
+        if ((size - pos) / 3 / static_cast<size_t>(width) < static_cast<size_t>(height)) return 0;
+        return pos;
+    }
+
+    /**
+     * Read-only mapping of a whole file, empty when the file cannot be mapped.
+     */
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string &name) : data_(nullptr), size_(0) {
+            int fd = open(name.c_str(), O_RDONLY);
+            if (fd < 0) return;
+            struct stat info;
+            if (fstat(fd, &info) == 0 && info.st_size > 0) {
+                void *data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED) {
+                    data_ = data;
+                    size_ = static_cast<size_t>(info.st_size);
+                    madvise(data_, size_, MADV_SEQUENTIAL);
+                }
+            }
+            close(fd);
+        }
+
+        ~MappedFile() {
+            if (data_) munmap(data_, size_);
+        }
+
+        MappedFile(const MappedFile &) = delete;
+
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        void advise(int advice) {
+            if (data_) madvise(data_, size_, advice);
+        }
+
+        const uchar *data() const {
+            return static_cast<const uchar *>(data_);
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+    private:
+        void *data_;
+        size_t size_;
+    };
+
+}
+
+ImageLoader::ImageLoader(const std::vector<std::string> &names, int scale, bool hashFiles, size_t prefetch)
+        : names_(names), flags_(decodeFlags(scale)), hash_files_(hashFiles), prefetch_(prefetch), read_count_(0),
+          requested_(false), stop_(false) {
+    thread_ = std::thread(&ImageLoader::run, this);
+}
+
+ImageLoader::~ImageLoader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    changed_.notify_all();
+    thread_.join();
+}
+
+bool ImageLoader::next(Image &image) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (read_count_ == names_.size()) return false;
+    requested_ = true;
+    changed_.notify_all();
+    changed_.wait(lock, [this] { return !ready_.empty(); });
+    requested_ = false;
+    image = std::move(ready_.front());
+    ready_.pop_front();
+    read_count_++;
+    changed_.notify_all();
+    return true;
+}
+
+void ImageLoader::recycle(cv::Mat &buffer) {
+    // the buffer returns to the pool once no other header refers to it
+    buffer.release();
+}
+
+int ImageLoader::decodeFlags(int scale) {
+    switch (scale) {
+        case 1:
+            return cv::IMREAD_COLOR;
+        case 2:
+            return cv::IMREAD_REDUCED_COLOR_2;
+        case 4:
+            return cv::IMREAD_REDUCED_COLOR_4;
+        case 8:
+            return cv::IMREAD_REDUCED_COLOR_8;
+        default:
+            CV_Error(cv::Error::StsBadArg, "decode scale has to be 1, 2, 4 or 8");
+    }
+}
+
+void ImageLoader::run() {
+    for (const std::string &name : names_) {
+        Image image;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            changed_.wait(lock, [this] {
+                return stop_ || ready_.size() < prefetch_ || (ready_.empty() && requested_);
+            });
+            if (stop_) return;
+        }
+
+        // an exception here would end the process, so any failure becomes an unreadable image
+        try {
+            load(name, image);
+        } catch (const std::exception &) {
+            image.image = cv::Mat();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready_.push_back(std::move(image));
+        }
+        changed_.notify_all();
+    }
+}
+
+void ImageLoader::load(const std::string &name, Image &image) {
+    image.name = name;
+    image.hash = 0;
+    image.mapping.reset();
+
+    auto file = std::make_shared<MappedFile>(name);
+    if (!file->data()) {
+        image.image = cv::Mat();
+        return;
+    }
+    if (hash_files_) {
+        image.hash = DetectionCache::hash(file->data(), file->size());
+    }
+
+    // raw pixels are used in place, scaled decoding still goes through the decoder
+    int width, height;
+    size_t offset = flags_ == cv::IMREAD_COLOR ? parseRawHeader(file->data(), file->size(), width, height) : 0;
+    if (offset != 0) {
+        file->advise(MADV_NORMAL);
+        image.image = cv::Mat(height, width, CV_8UC3, const_cast<uchar *>(file->data() + offset));
+        image.mapping = file;
+        return;
+    }
+
+    if (file->size() > static_cast<size_t>(std::numeric_limits<int>::max())) {
+        image.image = cv::Mat();
+        return;
+    }
+    // the decoder reads the mapping directly, a fresh header gets its buffer from the pool only once
+    // decoding succeeds, so a failed decode leaves it empty
+    cv::Mat encoded(1, static_cast<int>(file->size()), CV_8UC1, const_cast<uchar *>(file->data()));
+    cv::Mat decoded;
+    decoded.allocator = &BufferPool::instance();
+    try {
+        cv::imdecode(encoded, flags_, &decoded);
+    } catch (const cv::Exception &) {
+        decoded.release();
+    }
+    image.image = decoded;
+}
@@ -0,0 +1,75 @@
+#ifndef POBR_IMAGELOADER_H
+#define POBR_IMAGELOADER_H
+
+#include <opencv2/core/core.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Decodes a list of image files on a background thread, staying up to prefetch images ahead of the reader.
+ * Files are memory-mapped and decoded straight from the mapping into pooled buffers,
+ * images given back with recycle return their buffers to be decoded into again.
+ * Binary PPM files are not decoded at full scale but mapped, so only the parts that are read take memory.
+ */
+class ImageLoader {
+public:
+    struct Image {
+        std::string name;
+        // hash of the encoded file, 0 unless requested
+        uint64_t hash;
+        // empty when the file could not be read or decoded
+        cv::Mat image;
+        // set for raw files, image is then a read-only view of the mapped file in RGB order
+        std::shared_ptr<const void> mapping;
+    };
+
+    /**
+     * Scale of 2, 4 or 8 lets the JPEG decoder downscale while decoding, 1 decodes in full resolution.
+     * Prefetch of 0 loads every image only once next asks for it, so no image is decoded ahead.
+     */
+    ImageLoader(const std::vector<std::string> &names, int scale, bool hashFiles, size_t prefetch = 2);
+
+    ~ImageLoader();
+
+    ImageLoader(const ImageLoader &) = delete;
+
+    ImageLoader &operator=(const ImageLoader &) = delete;
+
+    /**
+     * Waits for the next image in order, returns false once all of them were read.
+     */
+    bool next(Image &image);
+
+    /**
+     * Releases an image that is no longer used, its buffer is decoded into again once no other header refers to it.
+     */
+    void recycle(cv::Mat &buffer);
+
+    static int decodeFlags(int scale);
+
+private:
+    const std::vector<std::string> names_;
+    const int flags_;
+    const bool hash_files_;
+    const size_t prefetch_;
+
+    std::deque<Image> ready_;
+    size_t read_count_;
+    bool requested_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::thread thread_;
+
+    void run();
+
+    void load(const std::string &name, Image &image);
+};
+
+#endif //POBR_IMAGELOADER_H
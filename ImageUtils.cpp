@@ -2,54 +2,41 @@
 
 #include <algorithm>
 #include <cmath>
-#include <deque>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <utility>
+#include "ImageKernels.h"
+#include "PointOpPipeline.h"
 #include "Utils.h"
 #include "Constants.h"
 
+namespace {
+
+    typedef void (*RankKernel)(const cv::Mat &, cv::Mat &);
+
+    template<int KernelSize, int... Ranks>
+    RankKernel rankKernelFor(int index, std::integer_sequence<int, Ranks...>) {
+        static const RankKernel kernels[] = {&ImageKernels::rankFilter<uchar, KernelSize, Ranks>...};
+        return kernels[index];
+    }
+
+    template<int KernelSize>
+    RankKernel rankKernelFor(int index) {
+        return rankKernelFor<KernelSize>(index, std::make_integer_sequence<int, KernelSize * KernelSize>());
+    }
+
+}
+
 cv::Mat ImageUtils::changeContrast(cv::Mat &I, float percent) {
     CV_Assert(I.depth() != sizeof(uchar));
-    switch (I.channels()) {
-        case 1:
-            for (int i = 0; i < I.rows; ++i)
-                for (int j = 0; j < I.cols; ++j)
-                    I.at<uchar>(i, j) = Utils::limitValue(I.at<uchar>(i, j) * percent);
-            break;
-        case 3:
-            cv::Mat_<cv::Vec3b> _I = I;
-            for (int i = 0; i < I.rows; ++i) {
-                for (int j = 0; j < I.cols; ++j) {
-                    for (int n = 0; n < 3; ++n) {
-                        _I(i, j)[n] = Utils::limitValue(_I(i, j)[n] * percent);
-                    }
-                }
-            }
-            I = _I;
-            break;
-    }
+    PointOpPipeline().changeContrast(percent).apply(I, I);
     return I;
 }
 
 cv::Mat ImageUtils::changeBrightness(cv::Mat &I, int amount) {
     CV_Assert(I.depth() != sizeof(uchar));
-    switch (I.channels()) {
-        case 1:
-            for (int i = 0; i < I.rows; ++i)
-                for (int j = 0; j < I.cols; ++j)
-                    I.at<uchar>(i, j) = Utils::limitValue(I.at<uchar>(i, j) + amount);
-            break;
-        case 3:
-            cv::Mat_<cv::Vec3b> _I = I;
-            for (int i = 0; i < I.rows; ++i) {
-                for (int j = 0; j < I.cols; ++j) {
-                    for (int n = 0; n < 3; ++n) {
-                        _I(i, j)[n] = Utils::limitValue(_I(i, j)[n] + amount);
-                    }
-                }
-            }
-            I = _I;
-            break;
-    }
+    PointOpPipeline().changeBrightness(amount).apply(I, I);
     return I;
 }
 
@@ -58,13 +45,7 @@ cv::Mat ImageUtils::convertRGBToGray(cv::Mat &I) {
     cv::Mat res(I.rows, I.cols, CV_8UC1);
     switch (I.channels()) {
         case 3:
-            cv::Mat_<cv::Vec3b> _I = I;
-            double wAvg;
-            for (int i = 0; i < I.rows; ++i)
-                for (int j = 0; j < I.cols; ++j) {
-                    wAvg = (_I(i, j)[0] * GRAY_B + _I(i, j)[1] * GRAY_G + _I(i, j)[2] * GRAY_R);
-                    res.at<uchar>(i, j) = Utils::limitValue(static_cast<int>(round(wAvg)));
-                }
+            PointOpPipeline().convertRGBToGray().apply(I, res);
             break;
     }
     return res;
@@ -75,89 +56,45 @@ cv::Mat ImageUtils::convertRGBToHSV(cv::Mat &I) {
     cv::Mat res(I.rows, I.cols, CV_8UC3); // H S V
     switch (I.channels()) {
         case 3:
-            int minIdx, maxIdx;
-            float minVal, maxVal;
-            int r, g, b;
-            float h, s, v;
-            cv::Mat_<cv::Vec3b> _R = res;
-            for (int i = 0; i < I.rows; ++i) {
-                for (int j = 0; j < I.cols; ++j) {
-                    cv::Vec3b intensity = I.at<cv::Vec3b>(i, j);
-                    b = intensity[BLUE_IDX];
-                    g = intensity[GREEN_IDX],
-                            r = intensity[RED_IDX];
-                    // max
-                    maxIdx = (b < g) ? GREEN_IDX : BLUE_IDX;
-                    maxIdx = (intensity[maxIdx] < r) ? RED_IDX : maxIdx;
-                    maxVal = intensity[maxIdx];
-                    // min
-                    minIdx = (b < g) ? BLUE_IDX : GREEN_IDX;
-                    minIdx = (intensity[minIdx] < r) ? minIdx : RED_IDX;
-                    minVal = intensity[minIdx];
-
-                    v = maxVal;
-                    s = v != 0 ? (v - minVal) / v : 0;
-                    switch (maxIdx) {
-                        case BLUE_IDX:
-                            h = 240 + 60 * (r - g) / (v - minVal);
-                            break;
-                        case GREEN_IDX:
-                            h = 120 + 60 * (b - r) / (v - minVal);
-                            break;
-                        case RED_IDX:
-                            h = 60 * (g - b) / (v - minVal);
-                            break;
-                        default:
-                            h = 0;
-                            break;
-                    }
-
-                    _R(i, j)[HUE_IDX] = h / 2;
-                    _R(i, j)[SAT_IDX] = 255 * s;
-                    _R(i, j)[VAL_IDX] = 255 * v;
-                }
-            }
-            res = _R;
+            ImageKernels::convertRGBToHSV<uchar>(I, res);
             break;
     }
     return res;
 }
 
+cv::Mat ImageUtils::swapRedBlue(const cv::Mat &I) {
+    CV_Assert(I.depth() == CV_8U && I.channels() == 3);
+    cv::Mat res(I.rows, I.cols, CV_8UC3);
+    for (int i = 0; i < I.rows; ++i) {
+        const uchar *src = I.ptr<uchar>(i);
+        uchar *dst = res.ptr<uchar>(i);
+        for (int j = 0; j < 3 * I.cols; j += 3) {
+            dst[j] = src[j + 2];
+            dst[j + 1] = src[j + 1];
+            dst[j + 2] = src[j];
+        }
+    }
+    return res;
+}
+
 cv::Mat ImageUtils::rankFilter(cv::Mat &I, const int kernelSize, const int index) {
     CV_Assert(I.depth() != sizeof(uchar));
-    cv::Mat res(I.rows, I.cols, CV_8UC3);
+    CV_Assert(index >= 0 && index < kernelSize * kernelSize);
+    // pixels closer to the border than the kernel reaches are left as they were
+    cv::Mat res = I.clone();
     switch (I.channels()) {
         case 3:
-            cv::Mat_<cv::Vec3b> _I = I;
-            cv::Mat_<cv::Vec3b> _R = res;
-            int offset = kernelSize / 2;
-            std::vector<std::pair<int, int>> values(kernelSize * kernelSize);
-
-            int x, y, count, winnerIndex;
-            for (int i = offset; i < I.rows - offset; ++i) {
-                for (int j = offset; j < I.cols - offset; ++j) {
-                    count = 0;
-                    for (int m = -offset; m < -offset + kernelSize; ++m) {
-                        for (int n = -offset; n < -offset + kernelSize; ++n) {
-                            x = i + m;
-                            y = j + n;
-                            values[count].first = x * I.cols + y;
-                            values[count].second = (_I(x, y)[0] + _I(x, y)[1] + _I(x, y)[2]) / 3;
-                            count++;
-                        }
-                    }
-                    std::nth_element(values.begin(), values.begin() + index, values.end(),
-                                     [](const std::pair<int, int> &a, const std::pair<int, int> &b) {
-                                         return a.second < b.second;
-                                     });
-                    winnerIndex = values[index].first;
-                    cv::Vec3b winner = _I(winnerIndex / I.cols, winnerIndex % I.cols);
-                    _R(i, j)[0] = winner[0];
-                    _R(i, j)[1] = winner[1];
-                    _R(i, j)[2] = winner[2];
-                }
+            switch (kernelSize) {
+                case 3:
+                    rankKernelFor<3>(index)(I, res);
+                    break;
+                case 5:
+                    rankKernelFor<5>(index)(I, res);
+                    break;
+                default:
+                    ImageKernels::rankFilter<uchar>(I, res, kernelSize, index);
+                    break;
             }
-            res = _R;
             break;
     }
     return res;
@@ -168,22 +105,10 @@ cv::Mat ImageUtils::inRange(cv::Mat &I, const cv::Scalar &s1, const cv::Scalar &
     cv::Mat res(I.rows, I.cols, CV_8UC1);
     switch (I.channels()) {
         case 1:
-            for (int i = 0; i < I.rows; ++i) {
-                for (int j = 0; j < I.cols; ++j) {
-                    res.at<uchar>(i, j) = Utils::isInBounds(I.at<uchar>(i, j), s1.val[0], s2.val[0]) ? MAX_VAL
-                                                                                                     : MIN_VAL;
-                }
-            }
+            ImageKernels::inRange<uchar, 1>(I, res, s1, s2);
             break;
         case 3:
-            cv::Mat_<cv::Vec3b> _I = I;
-            for (int i = 0; i < I.rows; ++i) {
-                for (int j = 0; j < I.cols; ++j) {
-                    res.at<uchar>(i, j) = Utils::isInBounds(_I(i, j)[0], s1.val[0], s2.val[0]) &&
-                                          Utils::isInBounds(_I(i, j)[1], s1.val[1], s2.val[1]) &&
-                                          Utils::isInBounds(_I(i, j)[2], s1.val[2], s2.val[2]) ? MAX_VAL : MIN_VAL;
-                }
-            }
+            ImageKernels::inRange<uchar, 3>(I, res, s1, s2);
             break;
     }
     return res;
@@ -191,68 +116,82 @@ cv::Mat ImageUtils::inRange(cv::Mat &I, const cv::Scalar &s1, const cv::Scalar &
 
 
 int ImageUtils::floodFill(cv::Mat &I, const cv::Point start, int targetColor, int replacementColor) {
+    FloodFillResult result;
+    FloodFillStack stack;
+    return floodFill(I, start, targetColor, replacementColor, result, stack);
+}
+
+int ImageUtils::floodFill(cv::Mat &I, const cv::Point start, int targetColor, int replacementColor,
+                          FloodFillResult &result, FloodFillStack &stack, FloodFillConnectivity connectivity) {
     CV_Assert(I.depth() != sizeof(uchar));
 
     switch (I.channels()) {
         case 1:
-            return floodFillImpl(I, start, targetColor, replacementColor);
+            return floodFillImpl(I, start, targetColor, replacementColor, result, stack, connectivity);
     }
     return 0;
 }
 
-int ImageUtils::floodFillImpl(cv::Mat &I, const cv::Point &start, int targetColor, int replacementColor) {
+int ImageUtils::floodFillImpl(cv::Mat &I, const cv::Point &start, int targetColor, int replacementColor,
+                              FloodFillResult &result, FloodFillStack &stack, FloodFillConnectivity connectivity) {
+    result.area = 0;
+    result.boundingBox = cv::Rect();
+    result.runs.clear();
 
     if (targetColor == replacementColor) return -1;
-    int startColor = I.at<uchar>(start);
-    if (startColor != targetColor) return -1;
-
-    int rows = I.rows;
-    int cols = I.cols;
-    std::function<bool(int, int)> isInRange = [&rows, &cols](int col, int row) {
-        return row > 0 && row < rows - 1 && col > 0 && col < cols - 1;
-    };
-
-    int areaCounter = 0;
-    std::deque<cv::Point> queue;
-    I.at<uchar>(start) = replacementColor;
-    queue.push_back(start);
-
-    while (!queue.empty()) {
-        areaCounter++;
-        cv::Point p = queue.front();
-        queue.pop_front();
-
-        if (isInRange(p.x, p.y - 1)) {
-            cv::Point west = cv::Point(p.x, p.y - 1);
-            if (I.at<uchar>(west) == targetColor) {
-                I.at<uchar>(west) = replacementColor;
-                queue.push_back(west);
-            }
-        }
-        if (isInRange(p.x, p.y + 1)) {
-            cv::Point east = cv::Point(p.x, p.y + 1);
-            if (I.at<uchar>(east) == targetColor) {
-                I.at<uchar>(east) = replacementColor;
-                queue.push_back(east);
-            }
-        }
-        if (isInRange(p.x + 1, p.y)) {
-            cv::Point north = cv::Point(p.x + 1, p.y);
-            if (I.at<uchar>(north) == targetColor) {
-                I.at<uchar>(north) = replacementColor;
-                queue.push_back(north);
-            }
-        }
-        if (isInRange(p.x - 1, p.y)) {
-            cv::Point south = cv::Point(p.x - 1, p.y);
-            if (I.at<uchar>(south) == targetColor) {
-                I.at<uchar>(south) = replacementColor;
-                queue.push_back(south);
+    if (I.ptr<uchar>(start.y)[start.x] != targetColor) return -1;
+
+    const uchar target = static_cast<uchar>(targetColor);
+    const uchar replacement = static_cast<uchar>(replacementColor);
+    // with 8-connectivity runs on neighbouring rows may also touch diagonally
+    const int reach = connectivity == CONNECTIVITY_8 ? 1 : 0;
+    int minX = start.x, maxX = start.x, minY = start.y, maxY = start.y;
+
+    stack.clear();
+    stack.push_back(start);
+    while (!stack.empty()) {
+        cv::Point seed = stack.back();
+        stack.pop_back();
+
+        uchar *row = I.ptr<uchar>(seed.y);
+        if (row[seed.x] != target) continue;
+
+        int left = seed.x;
+        while (left > 0 && row[left - 1] == target) --left;
+        int right = seed.x;
+        while (right < I.cols - 1 && row[right + 1] == target) ++right;
+
+        std::memset(row + left, replacement, static_cast<size_t>(right - left + 1));
+        result.runs.push_back({seed.y, left, right});
+        result.area += right - left + 1;
+        minX = std::min(minX, left);
+        maxX = std::max(maxX, right);
+        minY = std::min(minY, seed.y);
+        maxY = std::max(maxY, seed.y);
+
+        int scanFrom = std::max(left - reach, 0);
+        int scanTo = std::min(right + reach, I.cols - 1);
+        for (int y = seed.y - 1; y <= seed.y + 1; y += 2) {
+            if (y < 0 || y >= I.rows) continue;
+            const uchar *neighbour = I.ptr<uchar>(y);
+            // one seed per contiguous target segment is enough, the span expansion finds the rest
+            for (int x = scanFrom; x <= scanTo; ++x) {
+                if (neighbour[x] == target && (x == scanFrom || neighbour[x - 1] != target)) {
+                    stack.push_back(cv::Point(x, y));
+                }
             }
         }
     }
 
-    return areaCounter;
+    result.boundingBox = cv::Rect(minX, minY, maxX - minX + 1, maxY - minY + 1);
+    return result.area;
+}
+
+void ImageUtils::drawRuns(cv::Mat &I, const std::vector<FloodFillRun> &runs, int color, const cv::Point &origin) {
+    for (const FloodFillRun &run : runs) {
+        std::memset(I.ptr<uchar>(run.y - origin.y) + run.xStart - origin.x, color,
+                    static_cast<size_t>(run.xEnd - run.xStart + 1));
+    }
 }
 
 cv::Mat ImageUtils::bitwise_xor(const cv::Mat &I1, const cv::Mat &I2) {
@@ -283,11 +222,16 @@ cv::Mat ImageUtils::bitwise_or(const cv::Mat &I1, const cv::Mat &I2) {
 
 int ImageUtils::calcPerimeter(const cv::Mat &I, int color, int backgroundColor) {
     int perimeter = 0;
-    for (int i = 1; i < I.rows - 1; ++i) {
-        for (int j = 1; j < I.cols - 1; ++j) {
-            if (I.at<uchar>(i, j) == color) {
-                if (I.at<uchar>(i - 1, j) == backgroundColor || I.at<uchar>(i + 1, j) == backgroundColor ||
-                    I.at<uchar>(i, j - 1) == backgroundColor || I.at<uchar>(i, j + 1) == backgroundColor) {
+    for (int i = 0; i < I.rows; ++i) {
+        const uchar *up = i > 0 ? I.ptr<uchar>(i - 1) : nullptr;
+        const uchar *row = I.ptr<uchar>(i);
+        const uchar *down = i < I.rows - 1 ? I.ptr<uchar>(i + 1) : nullptr;
+        for (int j = 0; j < I.cols; ++j) {
+            if (row[j] == color) {
+                // pixels outside of the frame count as background
+                if (!up || !down || j == 0 || j == I.cols - 1 ||
+                    up[j] == backgroundColor || down[j] == backgroundColor ||
+                    row[j - 1] == backgroundColor || row[j + 1] == backgroundColor) {
                     perimeter++;
                 }
             }
@@ -296,6 +240,77 @@ int ImageUtils::calcPerimeter(const cv::Mat &I, int color, int backgroundColor)
     return perimeter;
 }
 
+int ImageUtils::traceContour(const cv::Mat &I, const cv::Point start, int color, ContourResult &result) {
+    CV_Assert(I.channels() == 1);
+    // Moore neighbourhood in clockwise order, starting from the west neighbour
+    static const cv::Point neighbours[8] = {
+            cv::Point(-1, 0), cv::Point(-1, -1), cv::Point(0, -1), cv::Point(1, -1),
+            cv::Point(1, 0), cv::Point(1, 1), cv::Point(0, 1), cv::Point(-1, 1)
+    };
+    auto isObject = [&I, color](const cv::Point &p) {
+        return p.x >= 0 && p.y >= 0 && p.x < I.cols && p.y < I.rows && I.ptr<uchar>(p.y)[p.x] == color;
+    };
+    // finds the next contour pixel clockwise from the backtrack direction and updates it
+    auto nextPixel = [&](const cv::Point &current, int &backtrack, cv::Point &next) {
+        for (int k = 0; k < 8; ++k) {
+            int direction = (backtrack + k) % 8;
+            cv::Point candidate = current + neighbours[direction];
+            // blobs are 4-connected, a diagonal step is valid only around an object corner
+            bool connected = direction % 2 == 0 ||
+                             isObject(current + neighbours[direction - 1]) ||
+                             isObject(current + neighbours[(direction + 1) % 8]);
+            if (connected && isObject(candidate)) {
+                next = candidate;
+                // the previously checked neighbour is background, seen from the new pixel it lies
+                // two steps counter-clockwise from where we came from (one step on even moves)
+                backtrack = (direction + (direction % 2 == 0 ? 6 : 5)) % 8;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    result.perimeter = 0;
+    result.contour.clear();
+    result.boundingBox = cv::Rect();
+    if (!isObject(start)) return -1;
+
+    result.contour.push_back(start);
+    int backtrack = 0;
+    cv::Point second;
+    if (nextPixel(start, backtrack, second)) {
+        cv::Point current = second;
+        for (;;) {
+            result.contour.push_back(current);
+            cv::Point next;
+            nextPixel(current, backtrack, next);
+            // stop once the trace is about to repeat its first step
+            if (current == start && next == second) {
+                result.contour.pop_back();
+                break;
+            }
+            current = next;
+        }
+    }
+
+    int minX = start.x, maxX = start.x, minY = start.y, maxY = start.y;
+    for (const cv::Point &p : result.contour) {
+        minX = std::min(minX, p.x);
+        maxX = std::max(maxX, p.x);
+        minY = std::min(minY, p.y);
+        maxY = std::max(maxY, p.y);
+    }
+    result.boundingBox = cv::Rect(minX, minY, maxX - minX + 1, maxY - minY + 1);
+
+    // thin parts of the object are walked twice, perimeter counts every boundary pixel once
+    std::vector<cv::Point> unique(result.contour);
+    std::sort(unique.begin(), unique.end(), [](const cv::Point &a, const cv::Point &b) {
+        return a.y < b.y || (a.y == b.y && a.x < b.x);
+    });
+    result.perimeter = static_cast<int>(std::unique(unique.begin(), unique.end()) - unique.begin());
+    return result.perimeter;
+}
+
 double ImageUtils::calcMoment(const cv::Mat &I, int p, int q, int color) {
     double moment = 0;
     for (int i = 0; i < I.rows; ++i) {
@@ -308,25 +323,71 @@ double ImageUtils::calcMoment(const cv::Mat &I, int p, int q, int color) {
     return moment;
 }
 
-std::map<std::string, double> ImageUtils::calcMomentums(const cv::Mat &I, int color) {
-    double m00 = calcMoment(I, 0, 0, color);
-    double m01 = calcMoment(I, 0, 1, color);
-    double m10 = calcMoment(I, 1, 0, color);
-    double m11 = calcMoment(I, 1, 1, color);
-    double m20 = calcMoment(I, 2, 0, color);
-    double m02 = calcMoment(I, 0, 2, color);
-
-    double M20 = m20 - (m10 * m10) / m00;
-    double M02 = m02 - (m01 * m01) / m00;
-    double M11 = m11 - ((m10 * m01) / m00);
-
-    double M1 = (M20 + M02) / (m00 * m00);
-    double M7 = (M20 * M02 - M11 * M11) / pow(m00, 4);
-
-    std::map<std::string, double> result;
-    result.insert(std::make_pair("M1", M1));
-    result.insert(std::make_pair("M7", M7));
-    return result;
+ObjectMoments ImageUtils::calcMomentums(const cv::Mat &I, int color) {
+    ObjectMoments m = {};
+    for (int i = 0; i < I.rows; ++i) {
+        const uchar *row = I.ptr<uchar>(i);
+        // per row sums of j^q are exact in integers, j^3 sums could overflow 64 bits on wide images
+        int64_t n = 0, s1 = 0, s2 = 0;
+        double s3 = 0;
+        for (int j = 0; j < I.cols; ++j) {
+            const int64_t hit = row[j] == color;
+            const int64_t j1 = hit * j;
+            n += hit;
+            s1 += j1;
+            s2 += j1 * j;
+            s3 += static_cast<double>(j1 * j) * j;
+        }
+        if (n == 0) continue;
+
+        const double x = i;
+        const double x2 = x * x;
+        m.m00 += n;
+        m.m10 += x * n;
+        m.m01 += s1;
+        m.m20 += x2 * n;
+        m.m11 += x * s1;
+        m.m02 += s2;
+        m.m30 += x2 * x * n;
+        m.m21 += x2 * s1;
+        m.m12 += x * s2;
+        m.m03 += s3;
+    }
+    if (m.m00 == 0) return m;
+
+    const double xc = m.m10 / m.m00;
+    const double yc = m.m01 / m.m00;
+    m.mu20 = m.m20 - xc * m.m10;
+    m.mu11 = m.m11 - xc * m.m01;
+    m.mu02 = m.m02 - yc * m.m01;
+    m.mu30 = m.m30 - 3 * xc * m.m20 + 2 * xc * xc * m.m10;
+    m.mu21 = m.m21 - 2 * xc * m.m11 - yc * m.m20 + 2 * xc * xc * m.m01;
+    m.mu12 = m.m12 - 2 * yc * m.m11 - xc * m.m02 + 2 * yc * yc * m.m10;
+    m.mu03 = m.m03 - 3 * yc * m.m02 + 2 * yc * yc * m.m01;
+
+    const double norm2 = m.m00 * m.m00;
+    const double norm3 = norm2 * std::sqrt(m.m00);
+    m.nu20 = m.mu20 / norm2;
+    m.nu11 = m.mu11 / norm2;
+    m.nu02 = m.mu02 / norm2;
+    m.nu30 = m.mu30 / norm3;
+    m.nu21 = m.mu21 / norm3;
+    m.nu12 = m.mu12 / norm3;
+    m.nu03 = m.mu03 / norm3;
+
+    const double a = m.nu30 + m.nu12;
+    const double b = m.nu21 + m.nu03;
+    const double c = m.nu30 - 3 * m.nu12;
+    const double d = 3 * m.nu21 - m.nu03;
+    const double e = m.nu20 - m.nu02;
+    m.hu[0] = m.nu20 + m.nu02;
+    m.hu[1] = e * e + 4 * m.nu11 * m.nu11;
+    m.hu[2] = c * c + d * d;
+    m.hu[3] = a * a + b * b;
+    m.hu[4] = c * a * (a * a - 3 * b * b) + d * b * (3 * a * a - b * b);
+    m.hu[5] = e * (a * a - b * b) + 4 * m.nu11 * a * b;
+    m.hu[6] = d * a * (a * a - 3 * b * b) - c * b * (3 * a * a - b * b);
+    return m;
 }
 
 int ImageUtils::calcArea(const cv::Mat &I, int color) {
@@ -405,8 +466,9 @@ cv::Rect ImageUtils::boundingRectOfObject(const cv::Mat &I, int color) {
 
 cv::Mat ImageUtils::imageWithMask(const cv::Mat &I, const cv::Rect &mask) {
     cv::Mat result = cv::Mat(I.rows, I.cols, CV_8UC1, cv::Scalar(0));
-    for (int i = mask.y; i < mask.y + mask.height; ++i) {
-        for (int j = mask.x; j < mask.x + mask.width; ++j) {
+    cv::Rect inside = mask & cv::Rect(0, 0, I.cols, I.rows);
+    for (int i = inside.y; i < inside.y + inside.height; ++i) {
+        for (int j = inside.x; j < inside.x + inside.width; ++j) {
             result.at<uchar>(i, j) = I.at<uchar>(i, j);
         }
     }
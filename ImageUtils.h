@@ -3,7 +3,49 @@
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
-#include <map>
+#include <vector>
+
+enum FloodFillConnectivity {
+    CONNECTIVITY_4 = 4,
+    CONNECTIVITY_8 = 8
+};
+
+/**
+ * Horizontal run of filled pixels, both ends inclusive.
+ */
+struct FloodFillRun {
+    int y;
+    int xStart;
+    int xEnd;
+};
+
+struct FloodFillResult {
+    int area;
+    cv::Rect boundingBox;
+    std::vector<FloodFillRun> runs;
+};
+
+/**
+ * Seed stack of the scanline flood fill, kept by callers filling many regions to reuse its storage.
+ */
+typedef std::vector<cv::Point> FloodFillStack;
+
+struct ContourResult {
+    int perimeter;
+    std::vector<cv::Point> contour;
+    cv::Rect boundingBox;
+};
+
+/**
+ * Raw (m), central (mu) and normalized central (nu) moments up to order 3 and the seven Hu invariants.
+ * The first index runs over rows and the second over columns, as in ImageUtils::calcMoment.
+ */
+struct ObjectMoments {
+    double m00, m10, m01, m20, m11, m02, m30, m21, m12, m03;
+    double mu20, mu11, mu02, mu30, mu21, mu12, mu03;
+    double nu20, nu11, nu02, nu30, nu21, nu12, nu03;
+    double hu[7];
+};
 
 class ImageUtils {
 public:
@@ -15,19 +57,39 @@ public:
 
     static cv::Mat convertRGBToHSV(cv::Mat &I);
 
+    /**
+     * Copy of a 3-channel image with its first and last channel swapped, turns RGB order into BGR.
+     */
+    static cv::Mat swapRedBlue(const cv::Mat &I);
+
     static cv::Mat rankFilter(cv::Mat &I, int kernelSize, int index);
 
     static cv::Mat inRange(cv::Mat &I, const cv::Scalar &s1, const cv::Scalar &s2);
 
     static int floodFill(cv::Mat &I, cv::Point start, int targetColor, int replacementColor);
 
+    static int floodFill(cv::Mat &I, cv::Point start, int targetColor, int replacementColor, FloodFillResult &result,
+                         FloodFillStack &stack, FloodFillConnectivity connectivity = CONNECTIVITY_4);
+
+    /**
+     * Draws runs given in coordinates of a larger image, origin is the position of I's top-left pixel in it.
+     */
+    static void drawRuns(cv::Mat &I, const std::vector<FloodFillRun> &runs, int color,
+                         const cv::Point &origin = cv::Point(0, 0));
+
     static cv::Mat bitwise_xor(const cv::Mat &I1, const cv::Mat &I2);
 
     static cv::Mat bitwise_or(const cv::Mat &I1, const cv::Mat &I2);
 
     static int calcPerimeter(const cv::Mat &I, int color, int backgroundColor);
 
-    static std::map<std::string, double> calcMomentums(const cv::Mat &I, int color);
+    /**
+     * Follows the outer boundary of the object containing start, which has to be its first pixel in raster order.
+     * Holes are not traced, so the perimeter counts outer boundary pixels only.
+     */
+    static int traceContour(const cv::Mat &I, cv::Point start, int color, ContourResult &result);
+
+    static ObjectMoments calcMomentums(const cv::Mat &I, int color);
 
     static int calcArea(const cv::Mat &I, int color);
 
@@ -43,7 +105,8 @@ public:
 
 private:
 
-    static int floodFillImpl(cv::Mat &I, const cv::Point &start, int targetColor, int replacementColor);
+    static int floodFillImpl(cv::Mat &I, const cv::Point &start, int targetColor, int replacementColor,
+                             FloodFillResult &result, FloodFillStack &stack, FloodFillConnectivity connectivity);
 
 };
 
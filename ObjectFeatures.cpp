@@ -8,35 +8,84 @@ void ObjectFeatures::print() {
               << "M1: " << M1 << '\t' << "M7: " << M7 << '\t' << std::endl;
 }
 
-ObjectFeatures::ObjectFeatures(const cv::Mat &I, int color, int backgroundColor): id(id_counter++) {
-    object = I.clone();
-    area = ImageUtils::calcArea(I, color);
-    perimeter = ImageUtils::calcPerimeter(I, color, backgroundColor);
-    W3 = ImageUtils::calcW3(area, perimeter);
+ObjectFeatures::ObjectFeatures(const cv::Mat &I, int color, int backgroundColor)
+        : ObjectFeatures(I, color, backgroundColor, cv::Rect(0, 0, I.cols, I.rows)) {
+}
 
-    auto widthHeight = ImageUtils::calcWidthHeight(I, color);
-    width = widthHeight.first;
-    height = widthHeight.second;
-    aspect = width / static_cast<double>(height);
+ObjectFeatures::ObjectFeatures(const cv::Mat &I, int color, int backgroundColor, const cv::Rect &region)
+        : id(id_counter++), color_(color) {
+    const cv::Rect inside = region & cv::Rect(0, 0, I.cols, I.rows);
+    const cv::Mat view = I(inside);
+    perimeter = ImageUtils::calcPerimeter(view, color, backgroundColor);
+
+    cv::Rect box = ImageUtils::boundingRectOfObject(view, color);
+    width = box.width;
+    height = box.height;
+    cv::Rect localBox = box.x < 0 ? cv::Rect() : cv::Rect(box.x, box.y, box.width + 1, box.height + 1);
+    boundingBox = box.x < 0 ? cv::Rect() : localBox + inside.tl();
+    object = view(localBox).clone();
+
+    calculateRegionFeatures(object, color, boundingBox.tl());
+}
 
-    auto momentums = ImageUtils::calcMomentums(I, color);
-    M1 = momentums.at("M1");
-    M2 = 0;
-    M3 = 0;
-    M4 = 0;
-    M5 = 0;
-    M6 = 0;
-    M7 = momentums.at("M7");
+ObjectFeatures::ObjectFeatures(const cv::Mat &I, int color, int backgroundColor, const cv::Point &contourStart,
+                               const cv::Point &origin, int id) : id(id < 0 ? id_counter++ : id), color_(color) {
+    // the outer contour only gives the box, the perimeter also has to count pixels around holes
+    ContourResult contour;
+    ImageUtils::traceContour(I, contourStart, color, contour);
 
-    double m00 = ImageUtils::calcMoment(I, 0, 0, color);
-    double m01 = ImageUtils::calcMoment(I, 0, 1, color);
-    double m10 = ImageUtils::calcMoment(I, 1, 0, color);
+    const cv::Rect &box = contour.boundingBox;
+    width = box.width - 1;
+    height = box.height - 1;
+    boundingBox = cv::Rect(box.x + origin.x, box.y + origin.y, box.width, box.height);
+    object = I(box).clone();
+    perimeter = ImageUtils::calcPerimeter(object, color, backgroundColor);
 
-    x_center = m10 / m00;
-    y_center = m01 / m00;
+    calculateRegionFeatures(object, color, boundingBox.tl());
 }
 
-int ObjectFeatures::id_counter = 1;
+ObjectFeatures::ObjectFeatures(const cv::FileNode &node) : id(id_counter++) {
+    perimeter = static_cast<int>(node["perimeter"]);
+    width = static_cast<int>(node["width"]);
+    height = static_cast<int>(node["height"]);
+    color_ = static_cast<int>(node["color"]);
+    node["box"] >> boundingBox;
+    node["object"] >> object;
+
+    calculateRegionFeatures(object, color_, boundingBox.tl());
+}
+
+void ObjectFeatures::write(cv::FileStorage &fs) const {
+    // remaining features are recomputed from the object mask when read
+    fs << "{" << "perimeter" << perimeter << "width" << width << "height" << height << "color" << color_
+       << "box" << boundingBox << "object" << object << "}";
+}
+
+void ObjectFeatures::calculateRegionFeatures(const cv::Mat &I, int color, const cv::Point &origin) {
+    moments = ImageUtils::calcMomentums(I, color);
+    area = static_cast<int>(moments.m00);
+    W3 = ImageUtils::calcW3(area, perimeter);
+    aspect = width / static_cast<double>(height);
+
+    // M1-M6 are the first six Hu invariants, M7 is (M20 * M02 - M11^2) / m00^4
+    M1 = moments.hu[0];
+    M2 = moments.hu[1];
+    M3 = moments.hu[2];
+    M4 = moments.hu[3];
+    M5 = moments.hu[4];
+    M6 = moments.hu[5];
+    M7 = moments.nu20 * moments.nu02 - moments.nu11 * moments.nu11;
+
+    // moments are taken over rows (x) and columns (y) of the region
+    x_center = static_cast<int>(moments.m10 / moments.m00) + origin.y;
+    y_center = static_cast<int>(moments.m01 / moments.m00) + origin.x;
+}
+
+std::atomic<int> ObjectFeatures::id_counter(1);
+
+int ObjectFeatures::reserveIds(int count) {
+    return id_counter.fetch_add(count);
+}
 
 cv::Point ObjectFeatures::getCenter() {
     return cv::Point(y_center, x_center);
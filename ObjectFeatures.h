@@ -2,10 +2,13 @@
 #define POBR_OBJECTFEATURES_H
 
 #include <opencv2/core/core.hpp>
+#include <atomic>
+#include "ImageUtils.h"
 
 class ObjectFeatures {
 public:
     const int id;
+    // object pixels with a background 4-neighbour, around holes as well as on the outer border
     int perimeter;
     int area;
     int x_center, y_center;
@@ -13,16 +16,52 @@ public:
     double aspect;
     double W3;
     double M1, M2, M3, M4, M5, M6, M7;
+    // moments of the object mask, taken relative to its bounding box
+    ObjectMoments moments;
+    // bounding box in image coordinates and the object mask cut to it
+    cv::Rect boundingBox;
     cv::Mat object;
 
     ObjectFeatures(const cv::Mat &I, int color, int backgroundColor);
 
+    /**
+     * Features of the pixels of I inside region only, as if everything outside it was background.
+     * Positions are given in coordinates of I.
+     */
+    ObjectFeatures(const cv::Mat &I, int color, int backgroundColor, const cv::Rect &region);
+
+    /**
+     * Features of a single blob, contourStart is its first pixel in raster order.
+     * Its outer contour gives the bounding box, remaining features are computed within that box only,
+     * so I must not hold other objects inside it.
+     * I may be a cut of a larger image, origin is the position of its top-left pixel in that image.
+     * A negative id takes the next free one, otherwise it has to come from reserveIds.
+     */
+    ObjectFeatures(const cv::Mat &I, int color, int backgroundColor, const cv::Point &contourStart,
+                   const cv::Point &origin = cv::Point(0, 0), int id = -1);
+
+    /**
+     * Restores features saved with write, the object gets a new id.
+     */
+    explicit ObjectFeatures(const cv::FileNode &node);
+
+    void write(cv::FileStorage &fs) const;
+
     void print();
 
     cv::Point getCenter();
 
+    /**
+     * Reserves count consecutive ids and returns the first one.
+     */
+    static int reserveIds(int count);
+
 private:
-    static int id_counter;
+    static std::atomic<int> id_counter;
+
+    int color_;
+
+    void calculateRegionFeatures(const cv::Mat &I, int color, const cv::Point &origin);
 };
 
 
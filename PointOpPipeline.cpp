@@ -0,0 +1,106 @@
+#include "PointOpPipeline.h"
+#include "Constants.h"
+
+PointOpPipeline::PointOpPipeline() : gray_(false) {
+    for (auto &lut : lut_) {
+        for (int v = 0; v < 256; ++v) {
+            lut[v] = static_cast<uchar>(v);
+        }
+    }
+}
+
+template<typename Op>
+void PointOpPipeline::appendOp(Op op) {
+    for (auto &lut : lut_) {
+        for (int v = 0; v < 256; ++v) {
+            lut[v] = op(lut[v]);
+        }
+    }
+}
+
+PointOpPipeline &PointOpPipeline::changeContrast(float percent) {
+    appendOp([percent](uchar v) { return cv::saturate_cast<uchar>(static_cast<int>(v * percent)); });
+    return *this;
+}
+
+PointOpPipeline &PointOpPipeline::changeBrightness(int amount) {
+    appendOp([amount](uchar v) { return cv::saturate_cast<uchar>(v + amount); });
+    return *this;
+}
+
+PointOpPipeline &PointOpPipeline::convertRGBToGray() {
+    CV_Assert(!gray_);
+    const int weights[3] = {GRAY_B_FIXED, GRAY_G_FIXED, GRAY_R_FIXED};
+    for (int n = 0; n < 3; ++n) {
+        for (int v = 0; v < 256; ++v) {
+            grayLut_[n][v] = lut_[n][v] * weights[n];
+        }
+    }
+    gray_ = true;
+    // following operations start from the gray value
+    for (auto &lut : lut_) {
+        for (int v = 0; v < 256; ++v) {
+            lut[v] = static_cast<uchar>(v);
+        }
+    }
+    return *this;
+}
+
+cv::Mat PointOpPipeline::apply(const cv::Mat &I) const {
+    cv::Mat res;
+    apply(I, res);
+    return res;
+}
+
+void PointOpPipeline::apply(const cv::Mat &I, cv::Mat &res) const {
+    CV_Assert(I.depth() == CV_8U && (I.channels() == 1 || I.channels() == 3));
+    if (gray_) {
+        CV_Assert(I.channels() == 3 && &res != &I);
+        res.create(I.rows, I.cols, CV_8UC1);
+        applyGray(I, res);
+    } else {
+        // tables are applied element-wise, so writing back into the source is safe
+        res.create(I.rows, I.cols, I.type());
+        applyColor(I, res);
+    }
+}
+
+void PointOpPipeline::applyColor(const cv::Mat &I, cv::Mat &res) const {
+    const int channels = I.channels();
+    const int width = I.cols * channels;
+    for (int i = 0; i < I.rows; ++i) {
+        const uchar *src = I.ptr<uchar>(i);
+        uchar *dst = res.ptr<uchar>(i);
+        if (channels == 1) {
+            const uchar *lut = lut_[0].data();
+            for (int j = 0; j < width; ++j) {
+                dst[j] = lut[src[j]];
+            }
+        } else {
+            const uchar *lutB = lut_[BLUE_IDX].data();
+            const uchar *lutG = lut_[GREEN_IDX].data();
+            const uchar *lutR = lut_[RED_IDX].data();
+            for (int j = 0; j < width; j += 3) {
+                dst[j + BLUE_IDX] = lutB[src[j + BLUE_IDX]];
+                dst[j + GREEN_IDX] = lutG[src[j + GREEN_IDX]];
+                dst[j + RED_IDX] = lutR[src[j + RED_IDX]];
+            }
+        }
+    }
+}
+
+void PointOpPipeline::applyGray(const cv::Mat &I, cv::Mat &res) const {
+    const int *lutB = grayLut_[BLUE_IDX].data();
+    const int *lutG = grayLut_[GREEN_IDX].data();
+    const int *lutR = grayLut_[RED_IDX].data();
+    const uchar *post = lut_[0].data();
+    const int half = 1 << (GRAY_SHIFT - 1);
+    for (int i = 0; i < I.rows; ++i) {
+        const uchar *src = I.ptr<uchar>(i);
+        uchar *dst = res.ptr<uchar>(i);
+        for (int j = 0; j < I.cols; ++j, src += 3) {
+            int sum = lutB[src[BLUE_IDX]] + lutG[src[GREEN_IDX]] + lutR[src[RED_IDX]];
+            dst[j] = post[(sum + half) >> GRAY_SHIFT];
+        }
+    }
+}
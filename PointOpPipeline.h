@@ -0,0 +1,43 @@
+#ifndef POBR_POINTOPPIPELINE_H
+#define POBR_POINTOPPIPELINE_H
+
+#include <opencv2/core/core.hpp>
+#include <array>
+
+/**
+ * Sequence of point operations folded into lookup tables and applied in a single pass over the image.
+ * Operations chained before convertRGBToGray act on every colour channel, the ones after it on the gray value.
+ */
+class PointOpPipeline {
+public:
+    PointOpPipeline();
+
+    PointOpPipeline &changeContrast(float percent);
+
+    PointOpPipeline &changeBrightness(int amount);
+
+    PointOpPipeline &convertRGBToGray();
+
+    cv::Mat apply(const cv::Mat &I) const;
+
+    /**
+     * Writes the result to res, which may be I itself unless the pipeline converts to gray.
+     */
+    void apply(const cv::Mat &I, cv::Mat &res) const;
+
+private:
+    // per channel tables, applied to the colour channels or to the gray value once it is computed
+    std::array<std::array<uchar, 256>, 3> lut_;
+    // channel tables folded with the fixed point gray weights
+    std::array<std::array<int, 256>, 3> grayLut_;
+    bool gray_;
+
+    template<typename Op>
+    void appendOp(Op op);
+
+    void applyColor(const cv::Mat &I, cv::Mat &res) const;
+
+    void applyGray(const cv::Mat &I, cv::Mat &res) const;
+};
+
+#endif //POBR_POINTOPPIPELINE_H
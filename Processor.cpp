@@ -1,62 +1,303 @@
 #include "Processor.h"
 #include "ImageUtils.h"
+#include "ImageLoader.h"
 #include "Utils.h"
+#include "Constants.h"
+#include <cmath>
 #include <iostream>
+#include <memory>
+#include <opencv2/core/utility.hpp>
 #include <opencv2/imgproc.hpp> // to draw rectangle around logo
 
 
 Processor::Processor() : blue_min_(cv::Scalar(95, 100, 0)), blue_max_(cv::Scalar(107, 255, 150)),
                          white_min_(cv::Scalar(0, 0, 0)), white_max_(cv::Scalar(180, 50, 120)),
-                         black_min_(cv::Scalar(0, 0, 150)), black_max_(cv::Scalar(180, 255, 255)) {
+                         black_min_(cv::Scalar(0, 0, 150)), black_max_(cv::Scalar(180, 255, 255)),
+                         memory_budget_(0), max_object_size_(200), cache_(nullptr),
+                         decode_scale_(1) {
 
 }
 
-void Processor::processImages(const std::vector<std::string> &names) {
-    for (const std::string &name : names) {
-        std::cout << name << std::endl;
-        cv::Mat source = cv::imread(name);
-        source = ImageUtils::rankFilter(source, 3, 4);
+namespace {
+
+    uint64_t hashRange(uint64_t seed, const cv::Scalar &min, const cv::Scalar &max) {
+        seed = DetectionCache::hash(min.val, sizeof(min.val), seed);
+        return DetectionCache::hash(max.val, sizeof(max.val), seed);
+    }
 
-        cv::Mat sourceClone = source.clone();
-        cv::Mat hsvImage = ImageUtils::convertRGBToHSV(sourceClone);
-        cv::Mat blueImg = ImageUtils::inRange(hsvImage, blue_min_, blue_max_); //hsv
-        cv::Mat whiteImg = ImageUtils::inRange(hsvImage, white_min_, white_max_); //hsv
-        cv::Mat blackImg = ImageUtils::inRange(hsvImage, black_min_, black_max_); //hsv
+}
 
-//        cv::imshow("Source", source);
-//        cv::imshow("HSV", hsvImage);
-//        cv::imshow("blue", blueImg);
-//        cv::imshow("black", blackImg);
-//        cv::imshow("white", whiteImg);
+void Processor::setMemoryBudget(size_t bytes) {
+    memory_budget_ = bytes;
+}
+
+void Processor::setMaxObjectSize(int pixels) {
+    CV_Assert(pixels > 0);
+    max_object_size_ = pixels;
+}
 
-        auto blue_features = calculateObjectFeatures(blueImg, 255, 0);
-        auto quartersBlue = findQuarters(blue_features);
+void Processor::setCache(DetectionCache *cache) {
+    cache_ = cache;
+}
+
+void Processor::setDecodeScale(int scale) {
+    ImageLoader::decodeFlags(scale);
+    decode_scale_ = scale;
+}
+
+void Processor::processImages(const std::vector<std::string> &names) {
+    // with a budget only the image being processed is decoded, prefetched ones would come on top of it
+    ImageLoader loader(names, decode_scale_, cache_ != nullptr, memory_budget_ != 0 ? 0 : 2);
+    ImageLoader::Image input;
+    while (loader.next(input)) {
+        std::cout << input.name << std::endl;
+        if (input.image.empty()) {
+            std::cout << "Cannot read " << input.name << std::endl;
+            continue;
+        }
+        cv::Mat &source = input.image;
+        const bool mapped = static_cast<bool>(input.mapping);
 
-        auto foundLogoRects = processFeatures(blue_features, whiteImg, blackImg);
+        auto foundLogoRects = detectCached(source, input.hash, mapped);
 
+        if (mapped) {
+            // mapped files are read-only and typically too large to show, rects are only listed
+            for (const auto &rect : foundLogoRects) {
+                std::cout << "Logo at " << rect << std::endl;
+            }
+            loader.recycle(source);
+            input.mapping.reset();
+            continue;
+        }
         for (const auto &rect : foundLogoRects) {
             cv::rectangle(source, rect, cv::Scalar(0, 0, 255), 2);
         }
         cv::imshow("Output", source);
         cv::waitKey(-1);
+        loader.recycle(source);
+    }
+}
+
+std::vector<cv::Rect> Processor::detectCached(cv::Mat &source, uint64_t imageHash, bool rgb) {
+    bool tiled = memory_budget_ != 0 && source.total() * TILE_BYTES_PER_PIXEL > memory_budget_;
+    cv::Mat converted;
+    if (rgb && !tiled) {
+        converted = ImageUtils::swapRedBlue(source);
+    }
+    cv::Mat &input = rgb && !tiled ? converted : source;
+    if (!cache_) {
+        return tiled ? detectTiled(source, rgb) : detect(input);
+    }
+
+    // blue blobs depend on the blue range only, the final rects on all the ranges and the tiling
+    const int version = PIPELINE_VERSION;
+    uint64_t featuresHash = DetectionCache::hash(&version, sizeof(version), imageHash);
+    featuresHash = DetectionCache::hash(&decode_scale_, sizeof(decode_scale_), featuresHash);
+    featuresHash = hashRange(featuresHash, blue_min_, blue_max_);
+    uint64_t rectsHash = hashRange(featuresHash, white_min_, white_max_);
+    rectsHash = hashRange(rectsHash, black_min_, black_max_);
+    if (tiled) {
+        rectsHash = DetectionCache::hash(&memory_budget_, sizeof(memory_budget_), rectsHash);
+        rectsHash = DetectionCache::hash(&max_object_size_, sizeof(max_object_size_), rectsHash);
+    }
+
+    const std::string rectsKey = DetectionCache::toKey(rectsHash);
+    std::vector<cv::Rect> rects;
+    if (cache_->loadRects(rectsKey, rects)) {
+        return rects;
+    }
+    rects = tiled ? detectTiled(source, rgb) : detect(input, DetectionCache::toKey(featuresHash));
+    cache_->storeRects(rectsKey, rects);
+    return rects;
+}
+
+std::vector<cv::Rect> Processor::detect(cv::Mat &source) {
+    return detect(source, std::string());
+}
+
+std::vector<cv::Rect> Processor::detect(cv::Mat &source, const std::string &featuresKey,
+                                        std::vector<cv::Rect> *blobBoxes) {
+    const bool cacheFeatures = cache_ && !featuresKey.empty();
+    std::vector<ObjectFeatures> blue_features;
+    const bool cachedFeatures = cacheFeatures && cache_->loadFeatures(featuresKey, blue_features);
+
+    cv::Mat filtered = ImageUtils::rankFilter(source, RANK_KERNEL_SIZE, RANK_INDEX);
+
+    cv::Mat hsvImage = ImageUtils::convertRGBToHSV(filtered);
+    filtered.release();
+    cv::Mat whiteImg = ImageUtils::inRange(hsvImage, white_min_, white_max_); //hsv
+    cv::Mat blackImg = ImageUtils::inRange(hsvImage, black_min_, black_max_); //hsv
+
+//    cv::imshow("Source", source);
+//    cv::imshow("black", blackImg);
+//    cv::imshow("white", whiteImg);
+
+    cv::Mat blueImg;
+    if (!cachedFeatures) {
+        blueImg = ImageUtils::inRange(hsvImage, blue_min_, blue_max_); //hsv
     }
+    hsvImage.release();
+
+    if (!cachedFeatures) {
+        blue_features = calculateObjectFeatures(blueImg, 255, 0);
+        blueImg.release();
+        if (cacheFeatures) {
+            cache_->storeFeatures(featuresKey, blue_features);
+        }
+    }
+    if (blobBoxes) {
+        blobBoxes->clear();
+        for (const ObjectFeatures &f : blue_features) {
+            blobBoxes->push_back(f.boundingBox);
+        }
+    }
+
+    return processFeatures(blue_features, whiteImg, blackImg);
+}
+
+std::vector<cv::Rect> Processor::detectTiled(const cv::Mat &source, bool rgb) {
+    CV_Assert(memory_budget_ != 0);
+    const int halo = tileHalo();
+    const int side = static_cast<int>(std::sqrt(static_cast<double>(memory_budget_ / TILE_BYTES_PER_PIXEL)));
+    // room is left for growing a tile by one blob on each side
+    int core = side - 2 * (halo + max_object_size_);
+    if (core < halo) {
+        // the halo alone does not fit, tiles get at least as big as their halo and exceed the budget
+        std::cout << "Memory budget too small for the halo, tiles exceed it" << std::endl;
+        core = halo;
+    }
+
+    // tiles of an RGB source are converted while read, so only the tile is ever held in BGR order
+    auto readTile = [&source, rgb](const cv::Rect &rect) {
+        return rgb ? ImageUtils::swapRedBlue(source(rect)) : source(rect);
+    };
+
+    const cv::Rect frame(0, 0, source.cols, source.rows);
+    std::vector<cv::Rect> result;
+    std::vector<cv::Rect> blobs;
+    for (int y = 0; y < source.rows; y += core) {
+        for (int x = 0; x < source.cols; x += core) {
+            cv::Rect coreRect = cv::Rect(x, y, core, core) & frame;
+            cv::Rect tileRect = cv::Rect(x - halo, y - halo, core + 2 * halo, core + 2 * halo) & frame;
+            cv::Mat tile = readTile(tileRect);
+            std::vector<cv::Rect> rects = detect(tile, std::string(), &blobs);
+
+            // a cut blob continues by at most one blob size, so growing once by that much is enough
+            cv::Rect grown = growOverCutBlobs(tileRect, coreRect, blobs, frame);
+            if (grown != tileRect) {
+                tileRect = grown;
+                tile.release();
+                tile = readTile(tileRect);
+                rects = detect(tile, std::string());
+            }
+
+            // a logo is reported by the tile owning its centre, the halo only provides its surroundings
+            for (cv::Rect rect : rects) {
+                rect.x += tileRect.x;
+                rect.y += tileRect.y;
+                if (coreRect.contains(cv::Point(rect.x + rect.width / 2, rect.y + rect.height / 2))) {
+                    result.push_back(rect);
+                }
+            }
+        }
+    }
+    return removeDuplicates(result);
+}
+
+cv::Rect Processor::growOverCutBlobs(const cv::Rect &tileRect, const cv::Rect &coreRect,
+                                     const std::vector<cv::Rect> &blobs, const cv::Rect &frame) const {
+    // pixels this close to the tile edge are not filtered, a blob reaching them may continue in the next tile
+    const int margin = RANK_KERNEL_SIZE / 2 + 1;
+    const int reach = max_object_size_;
+    int left = 0, top = 0, right = 0, bottom = 0;
+    for (cv::Rect blob : blobs) {
+        // blobs larger than the max object size are no logo parts, whole or cut
+        if (blob.width > max_object_size_ || blob.height > max_object_size_) {
+            continue;
+        }
+        blob.x += tileRect.x;
+        blob.y += tileRect.y;
+        // search windows in processFeatures reach twice the blob size from its centre
+        cv::Rect window(blob.x - 2 * reach, blob.y - 2 * reach, blob.width + 4 * reach, blob.height + 4 * reach);
+        if ((window & coreRect).area() == 0) {
+            continue;
+        }
+        if (blob.x < tileRect.x + margin && tileRect.x > frame.x) {
+            left = reach;
+        }
+        if (blob.y < tileRect.y + margin && tileRect.y > frame.y) {
+            top = reach;
+        }
+        if (blob.br().x > tileRect.br().x - margin && tileRect.br().x < frame.br().x) {
+            right = reach;
+        }
+        if (blob.br().y > tileRect.br().y - margin && tileRect.br().y < frame.br().y) {
+            bottom = reach;
+        }
+    }
+    return cv::Rect(tileRect.x - left, tileRect.y - top, tileRect.width + left + right,
+                    tileRect.height + top + bottom) & frame;
+}
+
+int Processor::tileHalo() const {
+    // search windows in processFeatures reach twice the blob size from its centre,
+    // the rectangle checked for black pixels grows a pair of blobs by a further 30%
+    return RANK_KERNEL_SIZE / 2 + 3 * max_object_size_;
+}
+
+std::vector<cv::Rect> Processor::removeDuplicates(const std::vector<cv::Rect> &rects) {
+    std::vector<cv::Rect> result;
+    for (const cv::Rect &rect : rects) {
+        bool duplicate = std::any_of(result.begin(), result.end(), [&rect](const cv::Rect &kept) {
+            int common = (rect & kept).area();
+            return common > 0 && 2 * common >= std::min(rect.area(), kept.area());
+        });
+        if (!duplicate) {
+            result.push_back(rect);
+        }
+    }
+    return result;
 }
 
 std::vector<ObjectFeatures> Processor::calculateObjectFeatures(cv::Mat &I, int color, int backgroundColor) {
-    std::vector<ObjectFeatures> result;
+    // labelling stays sequential, every fill depends on the image left by the previous ones
+    std::vector<FloodFillResult> blobs;
+    std::vector<cv::Point> starts;
     cv::Mat input = I.clone();
+    FloodFillResult fill;
+    FloodFillStack stack;
     for (int i = 0; i < input.rows; ++i) {
         for (int j = 0; j < input.cols; ++j) {
             if (input.at<uchar>(i, j) == color) {
-                cv::Mat before = input.clone();
-                int area = ImageUtils::floodFill(input, cv::Point(j, i), color, backgroundColor);
+                int area = ImageUtils::floodFill(input, cv::Point(j, i), color, backgroundColor, fill, stack);
                 if (area > 20) {
-                    cv::Mat object = ImageUtils::bitwise_xor(before, input);
-                    result.push_back(ObjectFeatures(object, color, backgroundColor));
+                    blobs.push_back(std::move(fill));
+                    starts.push_back(cv::Point(j, i));
+                    fill = FloodFillResult();
                 }
             }
         }
     }
+
+    // features of separate blobs are independent, ids are reserved upfront so they do not depend on scheduling
+    const int count = static_cast<int>(blobs.size());
+    const int firstId = ObjectFeatures::reserveIds(count);
+    std::vector<std::unique_ptr<ObjectFeatures>> features(blobs.size());
+    cv::parallel_for_(cv::Range(0, count), [&](const cv::Range &range) {
+        for (int k = range.start; k < range.end; ++k) {
+            const cv::Rect &box = blobs[k].boundingBox;
+            cv::Mat object(box.height, box.width, CV_8UC1, cv::Scalar(backgroundColor));
+            ImageUtils::drawRuns(object, blobs[k].runs, color, box.tl());
+            features[k].reset(new ObjectFeatures(object, color, backgroundColor, starts[k] - box.tl(), box.tl(),
+                                                 firstId + k));
+        }
+    });
+
+    std::vector<ObjectFeatures> result;
+    result.reserve(features.size());
+    for (auto &f : features) {
+        result.push_back(std::move(*f));
+    }
     return result;
 }
 
@@ -88,58 +329,83 @@ Processor::processFeatures(const std::vector<ObjectFeatures> &input, cv::Mat &wh
         return featurePredicate && areaPredicate && otherFeaturesInsideRect > 0;
     };
 
-    std::vector<ObjectFeatures> filtered;
-    std::copy_if(input.begin(), input.end(), std::back_inserter(filtered), filterFunc);
+    // parallel stages write into slots indexed like their input and are gathered in that order afterwards
+    std::vector<char> accepted(input.size());
+    cv::parallel_for_(cv::Range(0, static_cast<int>(input.size())), [&](const cv::Range &range) {
+        for (int k = range.start; k < range.end; ++k) {
+            accepted[k] = filterFunc(input[k]);
+        }
+    });
 
-    std::map<int, ObjectFeatures> blueObjects;
-    std::transform(filtered.begin(), filtered.end(), std::inserter(blueObjects, blueObjects.begin()),
-                   [](const ObjectFeatures &f) { return std::make_pair(f.id, f); });
+    std::vector<const ObjectFeatures *> blueObjects;
+    for (size_t k = 0; k < input.size(); ++k) {
+        if (accepted[k]) {
+            blueObjects.push_back(&input[k]);
+        }
+    }
 
-    auto closestObjectFunc = [&](const ObjectFeatures &f) {
+    auto closestObjectFunc = [&](int index) {
+        const ObjectFeatures &f = *blueObjects[index];
         auto best = std::make_pair(-1, std::numeric_limits<double>::max());
-        std::for_each(blueObjects.begin(), blueObjects.end(), [&](const std::pair<int, ObjectFeatures> &pair) {
-            if (pair.first != f.id) {
-                double distance = Utils::distance(f.x_center, f.y_center, pair.second.x_center, pair.second.y_center);
-                if (distance < best.second &&
-                    Utils::isInBounds(f.width / static_cast<double>(pair.second.width), 0.6, 1.4)) {
-                    best.first = pair.first;
+        for (int other = 0; other < static_cast<int>(blueObjects.size()); ++other) {
+            const ObjectFeatures &o = *blueObjects[other];
+            if (other != index) {
+                double distance = Utils::distance(f.x_center, f.y_center, o.x_center, o.y_center);
+                if (distance < best.second && Utils::isInBounds(f.width / static_cast<double>(o.width), 0.6, 1.4)) {
+                    best.first = other;
                     best.second = distance;
                 }
             }
-        });
-        return best;
+        }
+        return best.first;
     };
 
-    std::map<int, int> blue_pairs;
-    std::for_each(blueObjects.begin(), blueObjects.end(), [&](const std::pair<int, ObjectFeatures> &pair) {
-        auto closest = closestObjectFunc(pair.second);
-        if (closest.first != -1) {
-            blue_pairs.insert(std::make_pair(pair.first, closest.first));
+    std::vector<int> closest(blueObjects.size());
+    cv::parallel_for_(cv::Range(0, static_cast<int>(blueObjects.size())), [&](const cv::Range &range) {
+        for (int k = range.start; k < range.end; ++k) {
+            closest[k] = closestObjectFunc(k);
         }
     });
 
+    // pairs refer to blue objects by their index
+    std::map<int, int> blue_pairs;
+    for (int k = 0; k < static_cast<int>(closest.size()); ++k) {
+        if (closest[k] != -1) {
+            blue_pairs.insert(std::make_pair(k, closest[k]));
+        }
+    }
+
     auto pairsConnected = getPairsConnected(blue_pairs);
     std::cout << "Number of pairs: " << pairsConnected.size() << std::endl;
 
-//    std::for_each(blueObjects.begin(), blueObjects.end(), [&](const std::pair<int, ObjectFeatures> &pair) {
-//        cv::imshow("Blue object", pair.second.object);
-//        std::cout << "id: " << pair.second.id << std::endl;
+//    std::for_each(blueObjects.begin(), blueObjects.end(), [&](const ObjectFeatures *f) {
+//        cv::imshow("Blue object", f->object);
+//        std::cout << "id: " << f->id << std::endl;
 //        cv::waitKey(-1);
 //    });
 
-    for (auto pair : pairsConnected) {
-        auto firstObj = blueObjects.find(pair.first)->second;
-        auto secondObj = blueObjects.find(pair.second)->second;
+    struct PairCheck {
+        bool whitePercentCorrect;
+        bool logoFound;
+        cv::Rect rect;
+    };
+
+    auto checkPairFunc = [&](const std::pair<int, int> &pair) {
+        PairCheck check = {false, false, cv::Rect()};
+        const ObjectFeatures &firstObj = *blueObjects[pair.first];
+        const ObjectFeatures &secondObj = *blueObjects[pair.second];
 
-        cv::Mat sum = ImageUtils::bitwise_or(firstObj.object, secondObj.object);
-        cv::Rect boundingRect = ImageUtils::boundingRectOfObject(sum, 255);
+        // same size as boundingRectOfObject gives, which does not count the last row and column
+        cv::Rect boundingRect = firstObj.boundingBox | secondObj.boundingBox;
+        boundingRect.width -= 1;
+        boundingRect.height -= 1;
 
-        cv::Mat cutWhite = ImageUtils::imageWithMask(white, boundingRect);
-        ObjectFeatures featWhite = ObjectFeatures(cutWhite, 255, 0);
+        // features are computed within the rectangles only, so each pair costs its own size rather than the frame's
+        ObjectFeatures featWhite = ObjectFeatures(white, 255, 0, boundingRect);
 
         double percent = featWhite.area / static_cast<double>(boundingRect.area());
         if (percent > 0.15 && percent < 0.55) {
-            std::cout << "White percent correct" << std::endl;
+            check.whitePercentCorrect = true;
             int new_width = 1.6 * boundingRect.width;
             int new_height = 1.6 * boundingRect.height;
 
@@ -147,19 +413,36 @@ Processor::processFeatures(const std::vector<ObjectFeatures> &input, cv::Mat &wh
             int new_y = Utils::boundValue(boundingRect.y - new_height * 0.3 / 2.0, 0, white.cols);
 
             cv::Rect rectForBlack(new_x, new_y, new_width, new_height);
-            cv::Mat cutBlack = ImageUtils::imageWithMask(black, rectForBlack);
-            ObjectFeatures blackObject = ObjectFeatures(cutBlack, 255, 0);
+            ObjectFeatures blackObject = ObjectFeatures(black, 255, 0, rectForBlack);
 
             if (blackObject.W3 > 4) {
-                continue;
+                return check;
             }
 
             if (rectForBlack.contains(blackObject.getCenter()) &&
                 Utils::isInBounds(rectForBlack.width / static_cast<double>(rectForBlack.height), 0.8, 1.2)) {
-                result.push_back(rectForBlack);
-                std::cout << "LOGO FOUND!!!" << std::endl;
+                check.logoFound = true;
+                check.rect = rectForBlack;
             }
         }
+        return check;
+    };
+
+    std::vector<PairCheck> checks(pairsConnected.size());
+    cv::parallel_for_(cv::Range(0, static_cast<int>(pairsConnected.size())), [&](const cv::Range &range) {
+        for (int k = range.start; k < range.end; ++k) {
+            checks[k] = checkPairFunc(pairsConnected[k]);
+        }
+    });
+
+    for (const PairCheck &check : checks) {
+        if (check.whitePercentCorrect) {
+            std::cout << "White percent correct" << std::endl;
+        }
+        if (check.logoFound) {
+            result.push_back(check.rect);
+            std::cout << "LOGO FOUND!!!" << std::endl;
+        }
     }
 
     return result;
@@ -5,6 +5,7 @@
 #include <vector>
 #include <map>
 #include <string>
+#include "DetectionCache.h"
 #include "ObjectFeatures.h"
 
 class Processor {
@@ -13,6 +14,39 @@ public:
 
     void processImages(const std::vector<std::string> &names);
 
+    std::vector<cv::Rect> detect(cv::Mat &source);
+
+    /**
+     * Runs detect on overlapping tiles sized to fit the memory budget and merges their results.
+     * With rgb the source is in RGB order, such as a mapped raw file, and each tile is converted when read.
+     * A tile cutting through a blue blob whose search window reaches the tile's core is grown once
+     * by the max object size on that side and processed again, the budget leaves room for that growth.
+     */
+    std::vector<cv::Rect> detectTiled(const cv::Mat &source, bool rgb = false);
+
+    /**
+     * Images whose processing would need more than budget bytes are processed in tiles, 0 disables tiling.
+     * Binary PPM files are mapped and read tile by tile, so their peak memory stays within the budget
+     * whatever their size. Other formats are decoded whole first, the budget then covers only their processing.
+     */
+    void setMemoryBudget(size_t bytes);
+
+    /**
+     * Largest expected blob extent in pixels, tiles overlap by enough to see whole logos made of such blobs.
+     * Budgets too small for that overlap still give tiles at least as large as it.
+     */
+    void setMaxObjectSize(int pixels);
+
+    /**
+     * Results are looked up in and stored to cache, nullptr disables caching.
+     */
+    void setCache(DetectionCache *cache);
+
+    /**
+     * Images are decoded at 1/scale of their resolution, scale is 1, 2, 4 or 8.
+     */
+    void setDecodeScale(int scale);
+
 private:
     cv::Scalar blue_min_;
     cv::Scalar blue_max_;
@@ -23,6 +57,23 @@ private:
     cv::Scalar black_min_;
     cv::Scalar black_max_;
 
+    size_t memory_budget_;
+    int max_object_size_;
+
+    DetectionCache *cache_;
+    int decode_scale_;
+
+    /**
+     * With rgb the source is in RGB order and is converted, whole or per tile, before detection.
+     */
+    std::vector<cv::Rect> detectCached(cv::Mat &source, uint64_t imageHash, bool rgb);
+
+    /**
+     * blobBoxes, if given, receives bounding boxes of the blue blobs.
+     */
+    std::vector<cv::Rect> detect(cv::Mat &source, const std::string &featuresKey,
+                                 std::vector<cv::Rect> *blobBoxes = nullptr);
+
     std::vector<ObjectFeatures> calculateObjectFeatures(cv::Mat &I, int color, int backgroundColor);
 
     std::vector<cv::Rect> processFeatures(const std::vector<ObjectFeatures> &input, cv::Mat &white, cv::Mat &black);
@@ -31,6 +82,17 @@ private:
 
     std::vector<std::pair<int, int>> getPairsConnected(const std::map<int, int> &pairsMap);
 
+    int tileHalo() const;
+
+    /**
+     * Tile grown by the max object size on every side where a blob that may belong to a logo in the core
+     * reaches the tile edge, limited to the frame. Blob boxes are given in tile coordinates.
+     */
+    cv::Rect growOverCutBlobs(const cv::Rect &tileRect, const cv::Rect &coreRect,
+                              const std::vector<cv::Rect> &blobs, const cv::Rect &frame) const;
+
+    std::vector<cv::Rect> removeDuplicates(const std::vector<cv::Rect> &rects);
+
 };
 
 #endif //POBR_PROCESSOR_H
@@ -12,8 +12,11 @@ int main() {
     std::string prefix = "../images/";
     std::transform(names.begin(), names.end(), names.begin(), [&prefix](const std::string& name) { return prefix + name; });
 
+    DetectionCache cache("../cache", 64 * 1024 * 1024);
     Processor processor;
+    processor.setCache(&cache);
     processor.processImages(names);
+    cache.print();
 
     cv::destroyAllWindows();
     return 0;